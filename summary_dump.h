@@ -0,0 +1,455 @@
+
+// summary_dump - read-only access to Windows summary dumps, 32-bit PAE and x64
+//
+// DumpContext::Open parses the header and bitmap, PopulateTlb mirrors the page
+// tables under a CR3 and BuildReverseMap indexes them. After that everything a
+// query needs is const: reads go through positional I/O with no shared file
+// offset, so one opened dump can serve any number of threads.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <climits>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef TLBDBG
+#define TLBTRACE(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__)
+#else
+#define TLBTRACE(...)
+#endif
+
+// Physical address bits 51:12 of a PAE or x64 paging entry
+const uint64_t PteAddressMask = 0x000FFFFFFFFFF000ull;
+inline uint64_t PaToPfn(uint64_t pa) { return (pa & PteAddressMask) >> 12; }
+inline uint64_t PageBase(uint64_t pa) { return pa & PteAddressMask; }
+
+// Sign extend bit 47 so 4-level walks produce canonical addresses
+inline uint64_t CanonicalVa(uint64_t va) { return uint64_t(int64_t(va << 16) >> 16); }
+
+// Fixed size blocks allocated a chunk at a time. Chunks never move, so growing
+// the pool never copies it and block pointers stay valid.
+template<typename T, size_t BlockSize>
+class BlockPool {
+public:
+	uint32_t Add(T fill) {
+		if(Count % BlocksPerChunk == 0) Chunks.emplace_back(new T[BlockSize * BlocksPerChunk]);
+		std::fill(Block(Count), Block(Count) + BlockSize, fill);
+		return Count++;
+	}
+	T *Block(uint32_t index) { return &Chunks[index / BlocksPerChunk][size_t(index % BlocksPerChunk) * BlockSize]; }
+	const T *Block(uint32_t index) const { return &Chunks[index / BlocksPerChunk][size_t(index % BlocksPerChunk) * BlockSize]; }
+	uint32_t size() const { return Count; }
+	void clear() { Chunks.clear(); Count = 0; }
+
+private:
+	enum { BlocksPerChunk = 1024 };
+	std::vector<std::unique_ptr<T[]>> Chunks;
+	uint32_t Count = 0;
+};
+
+// Page tables reachable from CR3. Every distinct table page is mirrored once as
+// a 512-entry block, so self-referencing and shared tables cost nothing extra
+// and there is no allocation per entry. Only tables walked above the last level
+// get a block of child links, last level tables (nearly all of them) do not.
+// Level 0 is the root: the 4-entry PDPT for PAE, the PML4 for x64.
+struct PageTableMirror {
+	enum : uint32_t { NoTable = UINT32_MAX };
+	struct TableInfo {
+		uint64_t Pa;    // Where the table lives in physical memory
+		uint32_t Links; // Block in Links, or NoTable for last level tables
+	};
+
+	int Levels = 0;                 // 3 for PAE, 4 for x64, 0 when nothing is mirrored
+	BlockPool<uint64_t, 512> Tables;// Raw entries
+	BlockPool<uint32_t, 512> Links; // Mirrored table each entry points to, or NoTable
+	std::vector<TableInfo> Info;    // One per table
+
+	int Shift(int level) const { return 12 + 9 * (Levels - 1 - level); }
+	// PS bit means a large page in PDEs, and in PDPTEs on x64 only
+	bool IsLeaf(int level, uint64_t entry) const { return level == Levels - 1 || (level > 0 && (entry & 0x80)); }
+	const uint64_t *Entries(uint32_t table) const { return Tables.Block(table); }
+	uint32_t Child(uint32_t table, uint32_t slot) const {
+		return Info[table].Links == NoTable ? NoTable : Links.Block(Info[table].Links)[slot];
+	}
+	uint32_t AddTable(uint64_t pa) {
+		Info.push_back({ pa, NoTable });
+		return Tables.Add(0);
+	}
+	void AddLinks(uint32_t table) { Info[table].Links = Links.Add(NoTable); }
+	void Clear() { Levels = 0; Tables.clear(); Links.clear(); std::vector<TableInfo>().swap(Info); }
+};
+
+// Reverse mapping entry, one per mapped page. Sorted by PFN then VA.
+struct PfnVaPair {
+	uint64_t Pfn;
+	uint64_t Va;
+	bool operator<(const PfnVaPair& o) const { return Pfn != o.Pfn ? Pfn < o.Pfn : Va < o.Va; }
+};
+
+// PFN -> VA index split by page size, so a large page is one entry and a
+// lookup is one binary search per size class. Pfn is the first PFN of the page.
+struct ReverseMap {
+	enum { Classes = 3 }; // 4K, 2M, 1G
+	static int PfnShift(int cls) { return cls * 9; }
+	std::vector<PfnVaPair> Pages[Classes];
+
+	size_t size() const { return Pages[0].size() + Pages[1].size() + Pages[2].size(); }
+	void clear() { for(auto& i : Pages) std::vector<PfnVaPair>().swap(i); }
+};
+
+class DumpContext {
+public:
+	DumpContext() = default;
+	DumpContext(const DumpContext&) = delete;
+	DumpContext& operator=(const DumpContext&) = delete;
+	~DumpContext() { Close(); }
+
+	// Open and validate a dump. On failure `error` describes why.
+	bool Open(const std::string& path, std::string& error);
+	void Close();
+
+	// Read `size` bytes at a physical address. The range must not cross a page.
+	bool ReadPhysical(uint64_t paddr, void *data, size_t size) const;
+	template<typename T>
+	bool ReadPhysicalAddress(uint64_t paddr, T& data) const { return ReadPhysical(paddr, &data, sizeof(T)); }
+
+	bool IsPagePresent(uint64_t pfn) const { return pfn < BitmapBits && (PagesBitmap[pfn / 64] >> (pfn % 64) & 1); }
+
+	bool Is64 = false;
+	bool PAE = false;
+	uint64_t CR3 = 0;
+	uint64_t BitmapBits = 0;
+	uint64_t PagesOffset = 0;
+	std::vector<uint64_t> PagesBitmap;
+	PageTableMirror Tables;
+	ReverseMap PfnToVa;
+
+private:
+	bool ReadFileAt(uint64_t offset, void *data, size_t size) const;
+	// Position of a present page among the pages stored in the file
+	uint64_t PageIndex(uint64_t pfn) const;
+
+	// Set bits before each 512-bit block of the bitmap
+	std::vector<uint64_t> PageRank;
+
+#ifdef _WIN32
+	HANDLE File = INVALID_HANDLE_VALUE;
+#else
+	int File = -1;
+#endif
+};
+
+inline bool DumpContext::ReadFileAt(uint64_t offset, void *data, size_t size) const
+{
+#ifdef _WIN32
+	// With an OVERLAPPED offset ReadFile ignores the shared file pointer
+	OVERLAPPED ov = {};
+	ov.Offset = DWORD(offset); ov.OffsetHigh = DWORD(offset >> 32);
+	DWORD got = 0;
+	return ReadFile(File, data, DWORD(size), &got, &ov) && got == size;
+#else
+	uint8_t *p = static_cast<uint8_t*>(data);
+	while(size) {
+		ssize_t got = pread(File, p, size, off_t(offset));
+		if(got <= 0) return false;
+		p += got; offset += got; size -= got;
+	}
+	return true;
+#endif
+}
+
+inline void DumpContext::Close()
+{
+#ifdef _WIN32
+	if(File != INVALID_HANDLE_VALUE) CloseHandle(File);
+	File = INVALID_HANDLE_VALUE;
+#else
+	if(File >= 0) close(File);
+	File = -1;
+#endif
+}
+
+inline bool DumpContext::Open(const std::string& path, std::string& error)
+{
+	uint32_t u32b = 0;
+	uint64_t BitmapOffset;
+
+	Close();
+#ifdef _WIN32
+	File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(File == INVALID_HANDLE_VALUE) return error = "Cannot open file.", false;
+#else
+	File = open(path.c_str(), O_RDONLY);
+	if(File < 0) return error = "Cannot open file.", false;
+#endif
+
+	// "DUMP" for 32 bit, "DU64" for 64 bit
+	if(!ReadFileAt(0x4, &u32b, 4)) return error = "Not a dump file.", false;
+	if(u32b == 'PMUD') Is64 = false;
+	else if(u32b == '46UD') Is64 = true;
+	else return error = "Not a 32 or 64 bit dump file.", false;
+
+	if(!Is64) {
+		// DUMP_HEADER32 is one page, SUMMARY_DUMP32 follows
+		uint32_t headerSize = 0, bitmapBits = 0, cr3 = 0;
+		uint8_t IsPae = 0;
+		if(!ReadFileAt(0xF88, &u32b, 4) || u32b != 2) return error = "Not summary dump file.", false;
+		ReadFileAt(0x100C, &headerSize, 4);
+		ReadFileAt(0x1010, &bitmapBits, 4);
+		ReadFileAt(0x10, &cr3, 4);
+		ReadFileAt(0x5C, &IsPae, 1);
+		PagesOffset = headerSize; BitmapBits = bitmapBits; CR3 = cr3; PAE = IsPae;
+		BitmapOffset = 0x1020;
+	} else {
+		// DUMP_HEADER64 is two pages, then the summary header: FirstPage at +0x20,
+		// TotalPresentPages at +0x28, bitmap bit count at +0x30, bitmap at +0x38
+		if(!ReadFileAt(0xF98, &u32b, 4) || u32b != 2) return error = "Not summary dump file.", false;
+		ReadFileAt(0x2020, &PagesOffset, 8);
+		ReadFileAt(0x2030, &BitmapBits, 8);
+		ReadFileAt(0x10, &CR3, 8);
+		PAE = false;
+		BitmapOffset = 0x2038;
+	}
+
+	// The bitmap has to fit between its offset and the first page
+	if(PagesOffset < BitmapOffset || BitmapBits > (PagesOffset - BitmapOffset) * 8) return error = "Truncated page bitmap.", false;
+
+	// Read physical memory bitmap, padded to whole 64 bit words
+	PagesBitmap.assign((BitmapBits + 63) / 64, 0);
+	if(!ReadFileAt(BitmapOffset, PagesBitmap.data(), (BitmapBits + 7) / 8)) return error = "Truncated page bitmap.", false;
+
+	// Rank directory, so locating a page never scans the bitmap
+	PageRank.assign((PagesBitmap.size() + 7) / 8, 0);
+	uint64_t count = 0;
+	for(size_t i = 0; i < PagesBitmap.size(); i++) {
+		if(i % 8 == 0) PageRank[i / 8] = count;
+		count += __builtin_popcountll(PagesBitmap[i]);
+	}
+	return true;
+}
+
+inline uint64_t DumpContext::PageIndex(uint64_t pfn) const
+{
+	uint64_t word = pfn / 64, ret = PageRank[word / 8];
+	for(uint64_t i = word & ~7ull; i < word; i++) ret += __builtin_popcountll(PagesBitmap[i]);
+	return ret + __builtin_popcountll(PagesBitmap[word] & ((1ull << (pfn % 64)) - 1));
+}
+
+inline bool DumpContext::ReadPhysical(uint64_t paddr, void *data, size_t size) const
+{
+	uint64_t PFN = paddr >> 12;
+	if((paddr & 0xFFF) + size > 0x1000) return false;
+	if(!IsPagePresent(PFN)) return false; // Check bitmap
+	return ReadFileAt(PagesOffset + 0x1000 * PageIndex(PFN) + (paddr & 0xFFF), data, size);
+}
+
+// Mirror the page tables under cr3 one level at a time. Returns the number of
+// present entries in last level tables.
+inline uint64_t PopulateTlb(DumpContext& ctx, uint64_t cr3)
+{
+	PageTableMirror& ret = ctx.Tables;
+	uint64_t PteCount = 0;
+
+	ret.Clear();
+	if(!ctx.Is64 && !ctx.PAE) return 0; // 2-level 32 bit paging is not supported
+	ret.Levels = ctx.Is64 ? 4 : 3;
+
+	// Root. The PAE PDPT is 4 entries at a 32 byte aligned CR3.
+	std::unordered_map<uint64_t, uint32_t> byPa;
+	uint32_t root;
+	if(ctx.Is64) {
+		root = ret.AddTable(PageBase(cr3));
+		ctx.ReadPhysical(PageBase(cr3), ret.Tables.Block(root), 0x1000);
+		byPa[PageBase(cr3)] = root;
+	} else {
+		root = ret.AddTable(cr3 & 0xFFFFFFE0);
+		ctx.ReadPhysical(cr3 & 0xFFFFFFE0, ret.Tables.Block(root), 4 * 8);
+	}
+	ret.AddLinks(root);
+
+	// Tables in `level` are walked at level lv and already have links. A table
+	// first seen at the last level and reached again higher up gets links then.
+	std::vector<uint32_t> level = { root }, next;
+	for(int lv = 0; lv < ret.Levels - 1; lv++) {
+		const bool childLinks = lv + 1 < ret.Levels - 1;
+		next.clear();
+		for(uint32_t table : level) {
+			uint32_t *links = ret.Links.Block(ret.Info[table].Links);
+			for(uint32_t ii = 0; ii < 512; ii++) {
+				uint64_t entry = ret.Entries(table)[ii];
+				if(!(entry & 1) || ret.IsLeaf(lv, entry)) continue;
+				uint64_t pa = PageBase(entry);
+				uint32_t child;
+				auto found = byPa.find(pa);
+				if(found != byPa.end()) {
+					child = found->second;
+					if(childLinks && ret.Info[child].Links == PageTableMirror::NoTable) {
+						ret.AddLinks(child);
+						next.push_back(child);
+					}
+				} else {
+					if(!ctx.IsPagePresent(pa >> 12)) continue;
+					child = ret.AddTable(pa);
+					ctx.ReadPhysical(pa, ret.Tables.Block(child), 0x1000);
+					byPa[pa] = child;
+					if(childLinks) ret.AddLinks(child);
+					next.push_back(child);
+					TLBTRACE("L%d #%u ==> %" PRIX64 "\n", lv, ii, pa);
+				}
+				links[ii] = child;
+			}
+		}
+		level.swap(next);
+	}
+	for(uint32_t table : level)
+		for(uint32_t ii = 0; ii < 512; ii++) PteCount += ret.Entries(table)[ii] & 1;
+
+	return PteCount;
+}
+
+// Walk every leaf below `table`, calling f(va, entry, level)
+template<typename F>
+void ForEachLeaf(const PageTableMirror& m, uint32_t table, int level, uint64_t vaBase, F&& f)
+{
+	for(uint64_t ii = 0; ii < 512; ii++) {
+		uint64_t entry = m.Entries(table)[ii];
+		if(!(entry & 1)) continue;
+		uint64_t va = vaBase | (ii << m.Shift(level));
+		if(m.Levels == 4) va = CanonicalVa(va);
+		if(m.IsLeaf(level, entry)) f(va, entry, level);
+		else if(m.Child(table, ii) != PageTableMirror::NoTable)
+			ForEachLeaf(m, m.Child(table, ii), level + 1, va, f);
+	}
+}
+
+// Build PFN -> VA index from the mirrored page tables. The tree is cut at the
+// page directory level, threads take directories off a shared counter and sort
+// their own entries, then the results get merged in parallel.
+inline size_t BuildReverseMap(DumpContext& ctx)
+{
+	const PageTableMirror& m = ctx.Tables;
+	ReverseMap& ret = ctx.PfnToVa;
+	ret.clear();
+	if(!m.Levels) return 0;
+
+	auto add = [&m](ReverseMap& out, uint64_t va, uint64_t entry, int level) {
+		int cls = m.Levels - 1 - level;
+		uint64_t pfn = PaToPfn(entry) & ~((1ull << ReverseMap::PfnShift(cls)) - 1);
+		out.Pages[cls].push_back({ pfn, va });
+	};
+
+	// Serial walk down to the page directories, large pages above them go straight in
+	struct WorkItem { uint32_t Table; uint64_t Va; };
+	std::vector<WorkItem> items = { { 0, 0 } }, next;
+	ReverseMap top;
+	for(int lv = 0; lv < m.Levels - 2; lv++) {
+		next.clear();
+		for(auto& t : items) {
+			for(uint64_t ii = 0; ii < 512; ii++) {
+				uint64_t entry = m.Entries(t.Table)[ii];
+				if(!(entry & 1)) continue;
+				uint64_t va = t.Va | (ii << m.Shift(lv));
+				if(m.Levels == 4) va = CanonicalVa(va);
+				if(m.IsLeaf(lv, entry)) add(top, va, entry, lv);
+				else if(m.Child(t.Table, ii) != PageTableMirror::NoTable)
+					next.push_back({ m.Child(t.Table, ii), va });
+			}
+		}
+		items.swap(next);
+	}
+
+	uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), 64u));
+	std::vector<ReverseMap> slices(threadCount);
+	std::vector<std::thread> workers;
+	std::atomic<size_t> nextItem(0);
+
+	auto worker = [&](uint32_t tid) {
+		ReverseMap& out = slices[tid];
+		for(size_t i; (i = nextItem++) < items.size(); )
+			ForEachLeaf(m, items[i].Table, m.Levels - 2, items[i].Va,
+				[&](uint64_t va, uint64_t entry, int level) { add(out, va, entry, level); });
+		for(auto& i : out.Pages) std::sort(i.begin(), i.end());
+	};
+	for(uint32_t i = 0; i < threadCount; i++) workers.emplace_back(worker, i);
+	for(auto& i : workers) i.join();
+	for(auto& i : top.Pages) std::sort(i.begin(), i.end());
+	slices.push_back(std::move(top));
+
+	// Merge sorted slices pairwise, log2(slices) rounds with each round's merges in parallel
+	for(int cls = 0; cls < ReverseMap::Classes; cls++) {
+		std::vector<std::vector<PfnVaPair>> runs;
+		for(auto& i : slices) runs.push_back(std::move(i.Pages[cls]));
+		while(runs.size() > 1) {
+			std::vector<std::vector<PfnVaPair>> merged((runs.size() + 1) / 2);
+			workers.clear();
+			for(size_t i = 0; i + 1 < runs.size(); i += 2)
+				workers.emplace_back([&runs, &merged, i]() {
+					std::vector<PfnVaPair>& out = merged[i / 2];
+					out.resize(runs[i].size() + runs[i + 1].size());
+					std::merge(runs[i].begin(), runs[i].end(), runs[i + 1].begin(), runs[i + 1].end(), out.begin());
+					std::vector<PfnVaPair>().swap(runs[i]);
+					std::vector<PfnVaPair>().swap(runs[i + 1]);
+				});
+			if(runs.size() % 2) merged.back() = std::move(runs.back());
+			for(auto& i : workers) i.join();
+			runs.swap(merged);
+		}
+		ret.Pages[cls] = std::move(runs[0]);
+	}
+	return ret.size();
+}
+
+// Every VA that maps the physical address, ascending. One binary search per
+// page size class.
+inline std::vector<uint64_t> PaToVas(const DumpContext& ctx, uint64_t pa)
+{
+	std::vector<uint64_t> ret;
+	uint64_t pfn = pa >> 12;
+	for(int cls = 0; cls < ReverseMap::Classes; cls++) {
+		const std::vector<PfnVaPair>& pages = ctx.PfnToVa.Pages[cls];
+		uint64_t base = pfn & ~((1ull << ReverseMap::PfnShift(cls)) - 1);
+		auto range = std::equal_range(pages.begin(), pages.end(), PfnVaPair{ base, 0 },
+			[](const PfnVaPair& a, const PfnVaPair& b) { return a.Pfn < b.Pfn; });
+		for(auto i = range.first; i != range.second; i++)
+			ret.push_back(i->Va + ((pfn - base) << 12) + (pa & 0xFFF));
+	}
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+inline uint64_t VaToPa(const DumpContext& ctx, uint64_t vaddr)
+{
+	const PageTableMirror& m = ctx.Tables;
+	if(!m.Levels) return ULLONG_MAX;
+	if(m.Levels == 3 ? vaddr >> 32 : CanonicalVa(vaddr) != vaddr) return ULLONG_MAX;
+
+	uint32_t table = 0;
+	for(int level = 0; level < m.Levels; level++) {
+		int shift = m.Shift(level);
+		uint32_t slot = (vaddr >> shift) & 0x1FF;
+		uint64_t entry = m.Entries(table)[slot];
+		if(!(entry & 1)) return ULLONG_MAX;
+		if(m.IsLeaf(level, entry)) {
+			uint64_t offsetMask = (1ull << shift) - 1;
+			return (PageBase(entry) & ~offsetMask) | (vaddr & offsetMask);
+		}
+		table = m.Child(table, slot);
+		if(table == PageTableMirror::NoTable) return ULLONG_MAX;
+	}
+	return ULLONG_MAX;
+}
@@ -0,0 +1,147 @@
+
+// summary_dump_bench - time the summary_dump reader against a dump file,
+// usually one written by summary_dump_gen
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <inttypes.h>
+
+#include "summary_dump.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+inline double Seconds(Clock::time_point since) { return chrono::duration<double>(Clock::now() - since).count(); }
+
+void ShowHelp() {
+	cout << "Args: dump-file [-n translations] [-r read-MiB] [-j jobs] [-u]\n\n"
+			"  -n: random VA translations to time, default 1000000\n"
+			"  -r: physical pages to read for throughput, in MiB, default 256\n"
+			"  -j: threads for the parallel read pass, 0 = all cores, default 0\n"
+			"  -u: don't check that 4K mapped pages carry summary_dump_gen's PA stamp,\n"
+			"      for dumps from elsewhere\n"
+		<< endl;
+}
+
+int main(int argc, char** argv)
+{
+	string path, error;
+	uint64_t translations = 1000000, readMiB = 256;
+	unsigned jobs = 0;
+	bool verify = true;
+	uint64_t errors = 0;
+
+	for(int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		try {
+			if(arg == "-h" || arg == "--help") return ShowHelp(), 0;
+			else if(arg == "-n" && i + 1 < argc) translations = stoull(argv[++i]);
+			else if(arg == "-r" && i + 1 < argc) readMiB = stoull(argv[++i]);
+			else if(arg == "-j" && i + 1 < argc) jobs = stoul(argv[++i]);
+			else if(arg == "-u") verify = false;
+			else if(path.empty()) path = arg;
+			else return ShowHelp(), 1;
+		} catch (...) { return cerr << "Invalid value for " << arg << '\n', 1; }
+	}
+	if(path.empty()) return ShowHelp(), 1;
+	if(!jobs) jobs = max(1u, thread::hardware_concurrency());
+
+	DumpContext ctx;
+	cout << fixed << setprecision(3);
+
+	auto t = Clock::now();
+	if(!ctx.Open(path, error)) return cerr << error << '\n', 1;
+	cout << "Open:           " << Seconds(t) * 1000 << " ms (" << ctx.BitmapBits << " PFNs)\n";
+
+	t = Clock::now();
+	uint64_t pteCount = PopulateTlb(ctx, ctx.CR3);
+	cout << "PopulateTlb:    " << Seconds(t) * 1000 << " ms (" << pteCount << " PTEs)\n";
+
+	t = Clock::now();
+	size_t mappings = BuildReverseMap(ctx);
+	cout << "BuildReverseMap:" << Seconds(t) * 1000 << " ms (" << mappings << " entries)\n";
+
+	// Half the lookups hit mapped VAs taken from the reverse map, half are uniform
+	// over the 32-bit or canonical 48-bit space. Addresses are generated before timing.
+	if(translations) {
+		const vector<PfnVaPair>& small = ctx.PfnToVa.Pages[0];
+		vector<uint64_t> vas(translations);
+		uint64_t x = 0x2545F4914F6CDD1Dull, hits = 0;
+		for(auto& i : vas) {
+			x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+			if((x & 1) && !small.empty()) i = small[(x >> 1) % small.size()].Va | (x >> 40 & 0xFFF);
+			else i = ctx.Is64 ? CanonicalVa(x >> 16) : uint32_t(x >> 16);
+		}
+		t = Clock::now();
+		for(auto i : vas) hits += VaToPa(ctx, i) != ULLONG_MAX;
+		double s = Seconds(t);
+		cout << "VaToPa:         " << s * 1e9 / translations << " ns/op (" << hits << " of " << translations << " mapped)\n";
+	}
+
+	// Every 4K mapping summary_dump_gen writes points at a present data page that
+	// starts with its own PA. Check a spread of them through VaToPa and
+	// ReadPhysical. Mappings through an x64 self-map entry point at page tables
+	// and are skipped. A generated dump without any 4K mappings means the page
+	// tables themselves were misread.
+	if(verify && ctx.PfnToVa.Pages[0].empty()) cerr << "Verify failed, no 4K mappings found\n", errors++;
+	else if(verify) {
+		const vector<PfnVaPair>& small = ctx.PfnToVa.Pages[0];
+		vector<bool> selfMap(512, false);
+		if(ctx.Tables.Levels == 4)
+			for(uint32_t i = 0; i < 512; i++) selfMap[i] = ctx.Tables.Child(0, i) == 0;
+		const size_t samples = min<uint64_t>(small.size(), max<uint64_t>(readMiB * 256, 1));
+		uint64_t checked = 0, bad = 0, page[512];
+		for(size_t i = 0; i < samples; i++) {
+			const PfnVaPair& m = small[small.size() * i / samples];
+			if(ctx.Tables.Levels == 4 && selfMap[(m.Va >> 39) & 0x1FF]) continue;
+			checked++;
+			if(VaToPa(ctx, m.Va) != m.Pfn << 12 || !ctx.ReadPhysicalAddress(m.Pfn << 12, page) || page[0] != m.Pfn << 12) {
+				if(!bad++) cerr << hex << "Verify failed at VA " << m.Va << " PFN " << m.Pfn << dec << '\n';
+			}
+		}
+		cout << "Verify:         " << checked - bad << " of " << checked << " mapped pages read back their PA\n";
+		errors += bad;
+	}
+
+	// Bulk reads walk present PFNs in order, first on one thread then on `jobs`
+	vector<uint64_t> pfns;
+	const uint64_t readPages = readMiB * 256;
+	for(uint64_t pfn = 0; pfn < ctx.BitmapBits && pfns.size() < readPages; pfn++)
+		if(ctx.IsPagePresent(pfn)) pfns.push_back(pfn);
+	if(!pfns.empty()) {
+		// Every PFN here is present, so every read has to succeed
+		auto readRange = [&ctx, &pfns](size_t begin, size_t end, uint64_t& sum, uint64_t& failed) {
+			uint64_t page[512];
+			for(size_t i = begin; i < end; i++)
+				if(ctx.ReadPhysicalAddress(uint64_t(pfns[i]) << 12, page)) sum += page[0];
+				else failed++;
+		};
+		const double mib = pfns.size() / 256.0;
+		uint64_t sum = 0, failed = 0;
+
+		t = Clock::now();
+		readRange(0, pfns.size(), sum, failed);
+		double s = Seconds(t);
+		cout << "Read x1:        " << mib / s << " MiB/s (" << mib << " MiB)\n";
+
+		vector<uint64_t> sums(jobs, 0), fails(jobs, 0);
+		vector<thread> workers;
+		t = Clock::now();
+		for(unsigned i = 0; i < jobs; i++)
+			workers.emplace_back(readRange, pfns.size() * i / jobs, pfns.size() * (i + 1) / jobs, ref(sums[i]), ref(fails[i]));
+		for(auto& i : workers) i.join();
+		s = Seconds(t);
+		cout << "Read x" << jobs << ":        " << mib / s << " MiB/s\n";
+		for(unsigned i = 0; i < jobs; i++) sum -= sums[i], failed += fails[i];
+		if(sum) cerr << "Parallel read checksum mismatch\n", errors++;
+		if(failed) cerr << failed << " present pages could not be read\n", errors += failed;
+	}
+
+	return errors ? 1 : 0;
+}
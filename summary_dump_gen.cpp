@@ -0,0 +1,238 @@
+
+// summary_dump_gen - write synthetic summary dumps, 32-bit PAE or x64, for
+// testing and benchmarking summary_dump_post_mortem
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <climits>
+#include <inttypes.h>
+#include <string.h>
+
+using namespace std;
+
+struct GenOptions {
+	bool X64 = false;           // DU64 header and 4-level page tables
+	uint64_t PhysMiB = 256;     // Physical address space covered by the bitmap
+	uint32_t Density = 50;      // Percentage of physical pages present in the dump
+	uint64_t MappedMiB = 64;    // VA range mapped with 4K pages
+	uint32_t LargePages = 16;   // 2MiB mappings placed after the 4K range
+	uint32_t HugePages = 0;     // 1GiB mappings placed after those, x64 only
+	uint64_t CR3 = 0x1000;
+	uint64_t Seed = 1;
+};
+
+// splitmix64, good enough and identical on every platform
+struct Rng {
+	uint64_t State;
+	uint64_t Next() {
+		uint64_t z = (State += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+};
+
+// Page tables being built. Table pages are taken from the lowest present PFNs
+// in order, so TablePfns stays sorted and the writer can merge it in one pass.
+struct TableBuilder {
+	int Levels;
+	const vector<uint64_t>& Bitmap;
+	uint64_t PfnCount, Cr3Pfn, NextFree = 0;
+	uint64_t Root[512] = {};
+	vector<uint64_t> TablePfns;
+	vector<uint64_t> Tables; // 512 entries per table, same order as TablePfns
+
+	TableBuilder(int levels, const vector<uint64_t>& bitmap, uint64_t pfnCount, uint64_t cr3Pfn)
+		: Levels(levels), Bitmap(bitmap), PfnCount(pfnCount), Cr3Pfn(cr3Pfn) {}
+
+	bool Present(uint64_t pfn) const { return Bitmap[pfn / 64] >> (pfn % 64) & 1; }
+	int Shift(int level) const { return 12 + 9 * (Levels - 1 - level); }
+
+	// Returns false when the dump has run out of present pages for tables
+	bool AllocTable(uint64_t& pfn) {
+		while(NextFree < PfnCount && (!Present(NextFree) || NextFree == Cr3Pfn)) NextFree++;
+		if(NextFree >= PfnCount) return false;
+		pfn = NextFree++;
+		TablePfns.push_back(pfn);
+		Tables.resize(Tables.size() + 512, 0);
+		return true;
+	}
+	uint64_t *Table(size_t index) { return index == SIZE_MAX ? Root : &Tables[index * 512]; }
+	// Map va to pa with the leaf at `leafLevel`, creating tables on the way.
+	// Tables are tracked by index since allocating one may move the pool.
+	bool Map(uint64_t va, uint64_t pa, int leafLevel) {
+		size_t table = SIZE_MAX;
+		for(int level = 0; level < leafLevel; level++) {
+			size_t slot = (va >> Shift(level)) & 0x1FF;
+			if(!(Table(table)[slot] & 1)) {
+				uint64_t pfn;
+				if(!AllocTable(pfn)) return false;
+				Table(table)[slot] = (pfn << 12) | 0x3;
+			}
+			uint64_t pfn = Table(table)[slot] >> 12 & 0xFFFFFFFFFFull;
+			table = lower_bound(TablePfns.begin(), TablePfns.end(), pfn) - TablePfns.begin();
+		}
+		Table(table)[(va >> Shift(leafLevel)) & 0x1FF] = pa | (leafLevel < Levels - 1 ? 0x83 : 0x3);
+		return true;
+	}
+};
+
+void ShowHelp() {
+	cout << "Args: output-file [-x] [-m phys-MiB] [-d density%] [-v mapped-MiB] [-l large-pages]\n"
+			"      [-g huge-pages] [-c cr3] [-s seed]\n\n"
+			"  -x: 64 bit dump with 4-level page tables, 32 bit PAE by default\n"
+			"  -m: physical memory size covered by the page bitmap, default 256\n"
+			"  -d: percentage of physical pages stored in the dump, default 50\n"
+			"  -v: VA range mapped with 4K pages, default 64. Starts at 0 for PAE,\n"
+			"      at FFFFF80000000000 for x64\n"
+			"  -l: number of 2MiB pages mapped after the 4K range, default 16\n"
+			"  -g: number of 1GiB pages mapped after the 2MiB pages, x64 only, default 0\n"
+			"  -c: CR3 (hex), default 1000. 32 byte aligned for PAE, 4K aligned for x64\n"
+			"  -s: random seed, default 1\n"
+		<< endl;
+}
+
+int main(int argc, char** argv)
+{
+	GenOptions opt;
+	string path;
+
+	for(int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		try {
+			if(arg == "-h" || arg == "--help") return ShowHelp(), 0;
+			else if(arg == "-x") opt.X64 = true;
+			else if(arg == "-m" && i + 1 < argc) opt.PhysMiB = stoull(argv[++i]);
+			else if(arg == "-d" && i + 1 < argc) opt.Density = stoul(argv[++i]);
+			else if(arg == "-v" && i + 1 < argc) opt.MappedMiB = stoull(argv[++i]);
+			else if(arg == "-l" && i + 1 < argc) opt.LargePages = stoul(argv[++i]);
+			else if(arg == "-g" && i + 1 < argc) opt.HugePages = stoul(argv[++i]);
+			else if(arg == "-c" && i + 1 < argc) opt.CR3 = stoull(argv[++i], 0, 16);
+			else if(arg == "-s" && i + 1 < argc) opt.Seed = stoull(argv[++i]);
+			else if(path.empty()) path = arg;
+			else return ShowHelp(), 1;
+		} catch (...) { return cerr << "Invalid value for " << arg << '\n', 1; }
+	}
+	if(path.empty()) return ShowHelp(), 1;
+
+	// PAE reaches 64GiB physical and 4GiB virtual, x64 is capped at 16TiB physical
+	// and 256GiB of 4K mappings here
+	const uint64_t pfnCount = min<uint64_t>(opt.PhysMiB, opt.X64 ? 16ull << 20 : 64 * 1024) * 256;
+	const uint64_t mappedPages = min<uint64_t>(opt.MappedMiB, opt.X64 ? 256 * 1024 : 4096) * 256;
+	const uint64_t vaBase = opt.X64 ? 0xFFFFF80000000000ull : 0;
+	const uint64_t vaLimit = opt.X64 ? 512ull << 30 : 4ull << 30; // One PML4 slot for x64
+	if(!opt.X64) opt.HugePages = 0;
+	if(opt.CR3 & (opt.X64 ? 0xFFF : 0x1F) || (opt.CR3 >> 12) >= pfnCount) return cerr << "Invalid CR3\n", 1;
+	opt.Density = max(1u, min(opt.Density, 100u));
+
+	Rng rng { opt.Seed };
+
+	// Choose present pages, CR3's page always is
+	vector<uint64_t> bitmap((pfnCount + 63) / 64, 0);
+	uint64_t presentCount = 0;
+	for(uint64_t pfn = 0; pfn < pfnCount; pfn++)
+		if(pfn == opt.CR3 >> 12 || rng.Next() % 100 < opt.Density) {
+			bitmap[pfn / 64] |= 1ull << (pfn % 64);
+			presentCount++;
+		}
+	auto randomPresent = [&]() {
+		uint64_t pfn;
+		do pfn = rng.Next() % pfnCount; while(!(bitmap[pfn / 64] >> (pfn % 64) & 1));
+		return pfn;
+	};
+
+	TableBuilder tb(opt.X64 ? 4 : 3, bitmap, pfnCount, opt.CR3 >> 12);
+	if(opt.X64) tb.Root[0x1ED] = opt.CR3 | 0x3; // Windows style self-map
+
+	// 4K mappings each point at a random present data page, so every one of them
+	// reads back its own PA stamp. Tables are built first so the targets can skip
+	// them. Then 2MiB and 1GiB pages at random aligned physical ranges.
+	uint64_t va = vaBase;
+	uint32_t largePages = 0, hugePages = 0;
+	for(uint64_t i = 0; i < mappedPages; i++, va += 0x1000)
+		if(!tb.Map(va, 0, tb.Levels - 1)) return cerr << "Not enough present pages for the page tables\n", 1;
+	if(presentCount <= tb.TablePfns.size() + 1) return cerr << "Not enough present pages for data\n", 1;
+	va = vaBase;
+	for(uint64_t i = 0; i < mappedPages; i++, va += 0x1000) {
+		uint64_t pfn;
+		do pfn = randomPresent(); while(pfn == opt.CR3 >> 12 || binary_search(tb.TablePfns.begin(), tb.TablePfns.end(), pfn));
+		tb.Map(va, pfn << 12, tb.Levels - 1);
+	}
+	va = (va + 0x1FFFFF) & ~0x1FFFFFull;
+	for(; largePages < opt.LargePages && va + (1 << 21) - vaBase <= vaLimit; largePages++, va += 1 << 21)
+		if(!tb.Map(va, (rng.Next() % max<uint64_t>(1, pfnCount / 512)) << 21, tb.Levels - 2))
+			return cerr << "Not enough present pages for the page tables\n", 1;
+	va = (va + 0x3FFFFFFF) & ~0x3FFFFFFFull;
+	for(; hugePages < opt.HugePages && va + (1ull << 30) - vaBase <= vaLimit; hugePages++, va += 1ull << 30)
+		if(!tb.Map(va, (rng.Next() % max<uint64_t>(1, pfnCount / 262144)) << 30, tb.Levels - 3))
+			return cerr << "Not enough present pages for the page tables\n", 1;
+
+	// Header, bitmap right after it, pages start at the next page boundary
+	const uint64_t bitmapOffset = opt.X64 ? 0x2038 : 0x1020;
+	const uint64_t bitmapBytes = (pfnCount + 7) / 8;
+	const uint64_t headerSize = (bitmapOffset + bitmapBytes + 0xFFF) & ~uint64_t(0xFFF);
+	vector<uint8_t> header(headerSize, 0);
+	auto put32 = [&header](size_t off, uint32_t v) { memcpy(&header[off], &v, 4); };
+	auto put64 = [&header](size_t off, uint64_t v) { memcpy(&header[off], &v, 8); };
+	memcpy(&header[0x0], "PAGE", 4);
+	if(opt.X64) {
+		memcpy(&header[0x4], "DU64", 4);
+		put64(0x10, opt.CR3);
+		put32(0xF98, 2); // Summary dump
+		memcpy(&header[0x2000], "SDMP", 4);
+		memcpy(&header[0x2004], "DUMP", 4);
+		put64(0x2020, headerSize);
+		put64(0x2028, presentCount);
+		put64(0x2030, pfnCount);
+	} else {
+		memcpy(&header[0x4], "DUMP", 4);
+		put32(0x10, uint32_t(opt.CR3));
+		header[0x5C] = 1; // PAE
+		put32(0xF88, 2);  // Summary dump
+		memcpy(&header[0x1000], "SDMP", 4);
+		memcpy(&header[0x1004], "DUMP", 4);
+		put32(0x100C, uint32_t(headerSize));
+		put32(0x1010, uint32_t(pfnCount));
+		put32(0x1014, uint32_t(presentCount));
+	}
+	memcpy(&header[bitmapOffset], bitmap.data(), bitmapBytes);
+
+	ofstream out(path, ios::binary | ios::out | ios::trunc);
+	if(!out) return cerr << "Cannot open output file.\n", 1;
+	out.write(reinterpret_cast<char*>(header.data()), header.size());
+
+	// Write pages in PFN order, batched so multi-GB dumps stay I/O bound
+	const size_t batchPages = 256;
+	vector<uint64_t> batch(batchPages * 512);
+	size_t inBatch = 0, nextTable = 0;
+	for(uint64_t pfn = 0; pfn < pfnCount; pfn++) {
+		if(!(bitmap[pfn / 64] >> (pfn % 64) & 1)) continue;
+		uint64_t *page = &batch[inBatch * 512];
+		if(pfn == opt.CR3 >> 12) {
+			memset(page, 0, 0x1000);
+			if(opt.X64) memcpy(page, tb.Root, 0x1000);
+			else memcpy(reinterpret_cast<uint8_t*>(page) + (opt.CR3 & 0xFFF), tb.Root, 4 * 8);
+		} else if(nextTable < tb.TablePfns.size() && tb.TablePfns[nextTable] == pfn) {
+			memcpy(page, &tb.Tables[nextTable * 512], 0x1000);
+			nextTable++;
+		} else {
+			// Data page, stamped with its PA so reads can be checked
+			for(int qq = 0; qq < 512; qq++) page[qq] = (pfn << 12) | (qq * 8);
+		}
+		if(++inBatch == batchPages) {
+			out.write(reinterpret_cast<char*>(batch.data()), inBatch * 0x1000);
+			inBatch = 0;
+		}
+	}
+	out.write(reinterpret_cast<char*>(batch.data()), inBatch * 0x1000);
+	out.close();
+	if(!out) return cerr << "Write failed.\n", 1;
+
+	cout << "Pages " << pfnCount << " present " << presentCount
+		 << " 4K mappings " << mappedPages << " 2MiB pages " << largePages << " 1GiB pages " << hugePages
+		 << " size " << (headerSize + presentCount * 0x1000) / 1048576 << " MiB\n";
+	return 0;
+}
@@ -4,297 +4,280 @@
 #include <sstream>
 #include <iomanip>
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <inttypes.h>
 #include <string.h>
 
-using namespace std;
-#define TOSTR reinterpret_cast<char*>
-
-
-inline uint32_t PaToPfn_PAE(uint64_t pa) { return (pa & 0xFFFFFF000) >> 12; }
-inline uint32_t PageBase_PAE(uint64_t pa) { return pa & 0xFFFFFF000; }
-
 #define TLBDBG
-#ifdef TLBDBG
-#define TLBTRACE(fmt, ...) printf(fmt, __VA_ARGS__)
-#else
-#define TLBTRACE(...)
-#endif
-
-union VirtAddr { uint32_t Addr; struct __attribute__((packed)) { uint32_t offset:12; uint32_t PTI:9; uint32_t PDI:9; uint32_t PDPI:2; } VA; };
-struct TLB_PAE {
-	struct _sPDPT {
-		_sPDPT() { BasePA = ULLONG_MAX; memset(sPDPTE, 0, sizeof(sPDPT)); }
-		~_sPDPT() { for(auto i : sPDPTE) if(i) delete i; }
-		uint64_t BasePA;
-		struct _sPDPTE_PAE {
-			_sPDPTE_PAE() { BasePA = ULLONG_MAX; memset(sPDE, 0, sizeof(sPDE)); }
-			~_sPDPTE_PAE() { for(auto i : sPDE) if(i) delete i; }
-			uint64_t BasePA;
-			struct _sPDE_PAE {
-				_sPDE_PAE() { BasePA = ULLONG_MAX; LargePage = false; memset(Pte, 0, sizeof(Pte)); }
-				uint64_t BasePA;
-				bool LargePage;
-				uint64_t Pte[512];
-			} *sPDE[512];
-		} *sPDPTE[4];
-	} sPDPT;
-};
-struct TLB {
-	struct _sPDE_PAE {
-		_sPDE_PAE() { BasePA = ULLONG_MAX; memset(Pte, 0, sizeof(Pte)); }
-		uint64_t BasePA;
-		uint64_t Pte[512];
-	} *sPDE[512];
-};
-
-struct DumpContext {
-	ifstream File;
-	size_t PagesOffset = 0;
-	uint8_t *PagesBitmap = nullptr;
-	bool PAE = false;
-	TLB_PAE TLBpae;
-	TLB TLBnopae;
-};
-
-template<typename T>
-inline bool ReadPhysicalAddress(DumpContext& ctx, uint64_t paddr, T& data)
-{
-	uint32_t PFN = paddr >> 12;
-	if(!(ctx.PagesBitmap[PFN / 8] & (1 << (PFN % 8)))) return false; // Check bitmap
-	uint32_t pageIndex = 0;
-	// Accumulate the populated bits to find out which page is it
-	for(uint32_t i = 0; i < PFN / 8; i++) pageIndex += __builtin_popcount((unsigned int)ctx.PagesBitmap[i]);
-	pageIndex += __builtin_popcount((unsigned int)(ctx.PagesBitmap[PFN / 8] & (0xFF >> (7 - PFN % 8))));
-	// Seek and read value
-	ctx.File.seekg(ctx.PagesOffset + 0x1000 * (pageIndex - 1) + (paddr & 0xFFF));
-	ctx.File.read(TOSTR(&data), sizeof(T));
-	return true;
-}
+#include "summary_dump.h"
 
-uint64_t PopulateTlb(DumpContext& ctx, uint32_t cr3)
-{
-	uint64_t PteCount = 0;
-	
-	TLB_PAE& ret = ctx.TLBpae;
-	// PDPT
-	ret.sPDPT.BasePA = cr3;
-	// PDPTE
-	for(int ii = 0; ii < 4; ii++) {
-		uint64_t PDPTE; ReadPhysicalAddress(ctx, uint64_t(cr3 + ii * 8), PDPTE);
-		if(!PaToPfn_PAE(PDPTE)) continue;
-		TLBTRACE("PDPTE #%d @ %X ==> %X\n", ii, cr3 + ii * 8, PageBase_PAE(PDPTE));
-		ret.sPDPT.sPDPTE[ii] = new TLB_PAE::_sPDPT::_sPDPTE_PAE;
-		ret.sPDPT.sPDPTE[ii]->BasePA = PageBase_PAE(PDPTE);
-		// PDE
-		for(int jj = 0; jj < 512; jj++) {
-			uint64_t pde; ReadPhysicalAddress(ctx, PageBase_PAE(PDPTE) + jj * 8, pde);
-			if(!(pde & 1)) continue;
-			ret.sPDPT.sPDPTE[ii]->sPDE[jj] = new TLB_PAE::_sPDPT::_sPDPTE_PAE::_sPDE_PAE;
-			ret.sPDPT.sPDPTE[ii]->sPDE[jj]->BasePA = PageBase_PAE(PDPTE) + jj * 8;
-			if(pde & 0x80) { // Large page, 2MiB on PAE system
-				TLBTRACE(" -- PDE #%d @ %X [LARGE]==> %X\n", jj, PageBase_PAE(PDPTE) + jj * 8, PageBase_PAE(pde));
-				ret.sPDPT.sPDPTE[ii]->sPDE[jj]->LargePage = true;
-				ret.sPDPT.sPDPTE[ii]->sPDE[jj]->Pte[0] = (pde & 0xFFFE00000); // This is the PA of large page
-				continue;
-			}
-			TLBTRACE(" -- PDE #%d @ %X ==> %X\n", jj, PageBase_PAE(PDPTE) + jj * 8, PageBase_PAE(pde));
-			// PTE
-			for(int kk = 0; kk < 512; kk++) {
-				uint64_t pte; ReadPhysicalAddress(ctx, PageBase_PAE(pde) + kk * 8, pte);
-				if(!(pte & 1)) continue;
-				ret.sPDPT.sPDPTE[ii]->sPDE[jj]->Pte[kk] = pte;
-				PteCount++;
-			}
-		}
-	}
-	
-	return PteCount;
-}
+using namespace std;
 
-inline uint64_t VaToPa(DumpContext& ctx, uint32_t vaddr)
+void DisplayReverseMapping(const DumpContext& ctx, ostream& out, uint64_t pa)
 {
-	uint64_t ret = ULLONG_MAX;
-	if(ctx.PAE) {
-		uint32_t PDPI = 0, PDI = 0, PTI = 0;
-		
-		PDPI = vaddr >> 30; if(!ctx.TLBpae.sPDPT.sPDPTE[PDPI]) return ret;
-		PDI = (vaddr >> 21) & 0x1FF; if(!ctx.TLBpae.sPDPT.sPDPTE[PDPI]->sPDE[PDI]) return ret;
-		
-		auto Pde = ctx.TLBpae.sPDPT.sPDPTE[PDPI]->sPDE[PDI];
-		if(Pde->LargePage) {
-			ret = Pde->Pte[0] + (vaddr & 0x1FFFFF);
-		} else {
-			PTI = (vaddr >> 12) & 0x1FF; if(!(Pde->Pte[PTI] & 1)) return ret;
-			ret = PageBase_PAE(Pde->Pte[PTI]) + (vaddr & 0xFFF);
-		}
-	} else {
-	}
-	return ret;
+	vector<uint64_t> vas = PaToVas(ctx, pa);
+	out << hex << uppercase << setfill('0');
+	out << " - PA " << pa << " (PFN " << (pa >> 12) << ") mapped " << dec << vas.size() << hex << " time(s)\n";
+	for(auto i : vas) out << setw(ctx.Is64 ? 16 : 8) << i << '\n';
+	out << dec << nouppercase << setfill(' ');
 }
 
-void DisplayVirtualMemory(DumpContext& ctx, uint32_t va, uint32_t size, int lineLength, int sepSize, bool showChars)
+void DisplayVirtualMemory(const DumpContext& ctx, ostream& out, uint64_t va, uint32_t size, int lineLength, int sepSize, bool showChars)
 {
-	static uint8_t page[4096];
-	uint32_t vaUpperbound = va + size;
+	uint8_t page[4096];
+	uint64_t vaUpperbound = va + size;
+	const int addrWidth = ctx.Is64 ? 16 : 8;
 	char filler[] = "                 "; filler[sepSize * 2 + 1] = 0;
-	auto width = cout.width();
-	cout << hex << uppercase << setfill('0') ;
-	// Check for page bound, round to 4K first
-	uint32_t pagebase = VaToPa(ctx, va & (~0xFFF));
-	cout << " - PA page base = " << pagebase << endl;
+	auto width = out.width();
+	out << hex << uppercase << setfill('0') ;
 	// Read an entire page, it's not a lot slower but definitely easier
 	while(va < vaUpperbound) {
-		ReadPhysicalAddress(ctx, pagebase, page);
+		// Check for page bound, round to 4K first
+		uint64_t pagebase = VaToPa(ctx, va & ~0xFFFull);
+		if(pagebase == ULLONG_MAX) out << " - VA not mapped\n";
+		else out << " - PA page base = " << pagebase << '\n';
+		if(!ctx.ReadPhysicalAddress(pagebase, page)) memset(page, 0, sizeof(page));
 //		uint32_t readSize = min(vaUpperbound - va, (va & 0xFFF ? va & 0xFFF : 4096));
 		int inPageOffset = va % 0x1000;
 		if(va % lineLength) { // Align to line bounds
-			cout << setw(8) << va - (va % lineLength) << " | ";
-			const uint32_t remainderInLine = lineLength - (va % lineLength);
-			for(uint32_t ii = 0; ii < va % lineLength; ii += sepSize) cout << filler;
-			for(uint32_t ii = 0; ii < remainderInLine; ii++) cout << setw(2) << int(page[inPageOffset + ii]) << ' ';
+			out << setw(addrWidth) << va - (va % lineLength) << " | ";
+			const uint64_t remainderInLine = lineLength - (va % lineLength);
+			for(uint32_t ii = 0; ii < va % lineLength; ii += sepSize) out << filler;
+			for(uint32_t ii = 0; ii < remainderInLine; ii++) out << setw(2) << int(page[inPageOffset + ii]) << ' ';
 			if(showChars){
-				for(uint32_t ii = 0; ii < va % lineLength; ii += sepSize) cout << ' ';
-				for(uint32_t ii = 0; ii < remainderInLine; ii++) {char c = page[inPageOffset + ii]; cout << ((c > 0x19)?c:'.');}
+				for(uint32_t ii = 0; ii < va % lineLength; ii += sepSize) out << ' ';
+				for(uint32_t ii = 0; ii < remainderInLine; ii++) {char c = page[inPageOffset + ii]; out << ((c > 0x19)?c:'.');}
 			}
-			cout << '\n';
+			out << '\n';
 			va += remainderInLine; inPageOffset += remainderInLine;
 		}
 		while(inPageOffset < 0x1000 && va < vaUpperbound) {
-			cout << setw(8) << va << " | ";
-			for(int ii = 0; ii < lineLength; ii++) cout << setw(2) << int(page[inPageOffset + ii]) << ' ';
+			out << setw(addrWidth) << va << " | ";
+			for(int ii = 0; ii < lineLength; ii++) out << setw(2) << int(page[inPageOffset + ii]) << ' ';
 			if(showChars)
-				for(int ii = 0; ii < lineLength; ii++) {char c = page[inPageOffset + ii]; cout << ((c > 0x19)?c:'.'); }
-			cout << '\n';
+				for(int ii = 0; ii < lineLength; ii++) {char c = page[inPageOffset + ii]; out << ((c > 0x19)?c:'.'); }
+			out << '\n';
 			va += lineLength; inPageOffset += lineLength;
 		}
 	}
-	cout << dec << nouppercase << setfill(' ') << setw(width);
+	out << dec << nouppercase << setfill(' ') << setw(width);
 }
 
-void DisplayPhysicalMemory(DumpContext& ctx, uint32_t pa, uint32_t size, int lineLength, int sepSize, bool showChars)
+void DisplayPhysicalMemory(const DumpContext& ctx, ostream& out, uint64_t pa, uint32_t size, int lineLength, int sepSize, bool showChars)
 {
-	static uint8_t page[4096];
-	uint32_t paUpperbound = pa + size;
+	uint8_t page[4096];
+	uint64_t paUpperbound = pa + size;
+	const int addrWidth = ctx.Is64 ? 16 : 8;
 	char filler[10] = "         "; filler[sepSize + 1] = 0;
-	auto width = cout.width();
-	cout << hex << uppercase << setfill('0') ;
-	// Check for page bound, round to 4K first
-	uint32_t pagebase = PageBase_PAE(pa & (~0xFFF));
-	cout << " - PA page base = " << pagebase << endl;
+	auto width = out.width();
+	out << hex << uppercase << setfill('0') ;
 	// Read an entire page, it's not a lot slower but definitely easier
 	while(pa < paUpperbound) {
-		ReadPhysicalAddress(ctx, pagebase, page);
+		// Check for page bound, round to 4K first
+		uint64_t pagebase = pa & ~0xFFFull;
+		out << " - PA page base = " << pagebase << '\n';
+		if(!ctx.ReadPhysicalAddress(pagebase, page)) memset(page, 0, sizeof(page));
 //		uint32_t readSize = min(paUpperbound - pa, (pa & 0xFFF ? pa & 0xFFF : 4096));
 		int inPageOffset = pa % 0x1000;
 		if(pa % lineLength) { // Align to line bounds
-			cout << setw(8) << pa - (pa % lineLength) << " | ";
-			const uint32_t remainderInLine = lineLength - (pa % lineLength);
-			for(uint32_t ii = 0; ii < pa % lineLength; ii += sepSize) cout << filler;
-			for(uint32_t ii = 0; ii < remainderInLine; ii++) cout << setw(2) << int(page[inPageOffset + ii]) << ' ';
+			out << setw(addrWidth) << pa - (pa % lineLength) << " | ";
+			const uint64_t remainderInLine = lineLength - (pa % lineLength);
+			for(uint32_t ii = 0; ii < pa % lineLength; ii += sepSize) out << filler;
+			for(uint32_t ii = 0; ii < remainderInLine; ii++) out << setw(2) << int(page[inPageOffset + ii]) << ' ';
 			if(showChars) {
-				for(uint32_t ii = 0; ii < pa % lineLength; ii += sepSize) cout << ' ';
-				for(uint32_t ii = 0; ii < remainderInLine; ii++) {char c = page[inPageOffset + ii]; cout << ((c > 0x19)?c:'.');}
+				for(uint32_t ii = 0; ii < pa % lineLength; ii += sepSize) out << ' ';
+				for(uint32_t ii = 0; ii < remainderInLine; ii++) {char c = page[inPageOffset + ii]; out << ((c > 0x19)?c:'.');}
 			}
-			cout << '\n';
+			out << '\n';
 			pa += remainderInLine; inPageOffset += remainderInLine;
 		}
 		while(inPageOffset < 0x1000 && pa < paUpperbound) {
-			cout << setw(8) << pa + inPageOffset << " | ";
-			for(int ii = 0; ii < lineLength; ii++) cout << setw(2) << int(page[inPageOffset + ii]) << ' ';
+			out << setw(addrWidth) << pa << " | ";
+			for(int ii = 0; ii < lineLength; ii++) out << setw(2) << int(page[inPageOffset + ii]) << ' ';
 			if(showChars)
-				for(int ii = 0; ii < lineLength; ii++) {char c = page[inPageOffset + ii]; cout << ((c > 0x19)?c:'.');}
-			cout << '\n';
+				for(int ii = 0; ii < lineLength; ii++) {char c = page[inPageOffset + ii]; out << ((c > 0x19)?c:'.');}
+			out << '\n';
 			pa += lineLength; inPageOffset += lineLength;
 		}
 	}
-	cout << dec << nouppercase << setfill(' ') << setw(width);
+	out << dec << nouppercase << setfill(' ') << setw(width);
 }
 
-void InteractiveSession(DumpContext& ctx)
+// Run one command line against the dump. Only reads the context, so any
+// number of these can run concurrently as long as each has its own stream.
+void ExecuteCommand(const DumpContext& ctx, const string& lineBuffer, ostream& out)
+{
+	switch(lineBuffer[0]) {
+	case 'd': { // Display memory
+		stringstream cmdss(lineBuffer);
+		string cmd; cmdss >> cmd;
+		if(cmd.size() != 2) { out << "Invalid command\n"; break; }
+		int sepSize = 1;
+		switch(cmd[1]) {
+			case 'b': sepSize = 1; break;
+			case 'w': sepSize = 2; break;
+			case 'd': sepSize = 4; break;
+			case 'q': sepSize = 8; break;
+		}
+		string addr; cmdss >> addr; if(addr.empty()) { out << "No address provided\n"; break; }
+		uint64_t addri;
+		try { addri = stoull(addr, 0, 16); } catch (...) { out << "Invalid address\n"; break; }
+		string qual; cmdss >> qual;
+		if(qual.find_first_of('P') != qual.npos)
+			DisplayPhysicalMemory(ctx, out, addri, 256, 16, sepSize, true);
+		else
+			DisplayVirtualMemory(ctx, out, addri, 256, 16, sepSize, true);
+		break;
+	}
+	case 'r': { // Reverse lookup, which VAs map the given PA
+		stringstream cmdss(lineBuffer);
+		string cmd, addr; cmdss >> cmd >> addr;
+		if(addr.empty()) { out << "No address provided\n"; break; }
+		uint64_t addri;
+		try { addri = stoull(addr, 0, 16); } catch (...) { out << "Invalid address\n"; break; }
+		DisplayReverseMapping(ctx, out, addri);
+		break;
+	}
+	default: break;
+	}
+}
+
+void InteractiveSession(const DumpContext& ctx)
 {
 	string lineBuffer;
 	cout << "Ready\n";
 	while(true) {
 		cout << "CMD> ";
-		getline(cin, lineBuffer);
+		if(!getline(cin, lineBuffer)) break;
 		if(lineBuffer.empty()) continue;
 		if(lineBuffer == "Q") break;
-		switch(lineBuffer[0]) {
-		case 'd': { // Display memory
-			stringstream cmdss(lineBuffer);
-			string cmd; cmdss >> cmd;
-			if(cmd.size() != 2) { cout << "Invalid command\n"; break; }
-			int sepSize = 1;
-			switch(cmd[1]) {
-				case 'b': sepSize = 1; break;
-				case 'w': sepSize = 2; break;
-				case 'd': sepSize = 4; break;
-				case 'q': sepSize = 8; break;
-			}
-			string addr; cmdss >> addr; if(addr.empty()) { cout << "No address provided\n"; break; }
-			uint32_t addri;
-			try { addri = stoul(addr, 0, 16); } catch (...) { cout << "Invalid address\n"; break; }
-			string qual; cmdss >> qual;
-			if(qual.find_first_of('P') != qual.npos)
-				DisplayPhysicalMemory(ctx, addri, 256, 16, sepSize, true);
-			else
-				DisplayVirtualMemory(ctx, addri, 256, 16, sepSize, true);
-		}
-		default: break;
-		}
+		ExecuteCommand(ctx, lineBuffer, cout);
 	}
 }
 
-int main()
+// Read every command up front, then run them on `jobs` threads. Each command
+// renders into its own buffer and the buffers are written out in script order.
+void BatchSession(const DumpContext& ctx, istream& script, ostream& out, unsigned jobs)
 {
-	string path;
-	uint32_t u32b, CR3, BitmapBytes;
-	uint8_t *Bitmap, IsPae;
-	DumpContext ctx;
-	
-	cout << "Summary dump file: >>> ";
-	getline(cin, path);
-	
-	ifstream& dump = ctx.File;
-	dump.open(path, ios::binary | ios::in);
-	if(!dump) return cout << "Cannot open file.", 1;
+	vector<string> commands;
+	string lineBuffer;
+	while(getline(script, lineBuffer)) {
+		if(!lineBuffer.empty() && lineBuffer.back() == '\r') lineBuffer.pop_back();
+		if(lineBuffer.empty() || lineBuffer[0] == '#') continue;
+		if(lineBuffer == "Q") break;
+		commands.push_back(lineBuffer);
+	}
 	
-	// Verify 32bit and Summary dump
-	dump.seekg(0x4); dump.read(TOSTR(&u32b), 4);
-	if(u32b != 'PMUD') return cout << "Not 32 bit dump file.\n", 1;
-	dump.seekg(0xF88); dump.read(TOSTR(&u32b), 4);
-	if(u32b != 2) return cout << "Not summary dump file.\n", 1;
+	if(jobs <= 1) {
+		for(auto& i : commands) {
+			out << "CMD> " << i << '\n';
+			ExecuteCommand(ctx, i, out);
+		}
+		return;
+	}
 	
-	// Read physical memory bitmap
-	dump.seekg(0x1010); dump.read(TOSTR(&u32b), 4);
-	BitmapBytes = (u32b + 7) / 8;
-	Bitmap = new uint8_t[BitmapBytes];
-	dump.seekg(0x1020); dump.read((char*)Bitmap, BitmapBytes);
-	ctx.PagesBitmap = Bitmap;
-	cout << "Bitmap size " << u32b << " Bytes=" << BitmapBytes << '\n';
+	vector<string> results(commands.size());
+	atomic<size_t> next(0);
+	auto worker = [&]() {
+		for(size_t i; (i = next++) < commands.size(); ) {
+			ostringstream ss;
+			ss << "CMD> " << commands[i] << '\n';
+			ExecuteCommand(ctx, commands[i], ss);
+			results[i] = ss.str();
+		}
+	};
+	vector<thread> workers;
+	for(unsigned i = 0; i < min<size_t>(jobs, commands.size()); i++) workers.emplace_back(worker);
+	for(auto& i : workers) i.join();
+	for(auto& i : results) out << i;
+}
+
+bool LoadDump(DumpContext& ctx, const string& path, ostream& log)
+{
+	string error;
+	if(!ctx.Open(path, error)) return log << error << '\n', false;
+	log << "Bitmap size " << ctx.BitmapBits << " Bytes=" << (ctx.BitmapBits + 7) / 8 << '\n';
+	if(ctx.Is64) log << "64 bit ";
+	else log << "PAE: " << (ctx.PAE ? "ON " : "OFF ");
+	log << hex << "CR3 = 0x" << ctx.CR3
+		<< dec << ". Importing PTEs..." << endl;
+
+	log << PopulateTlb(ctx, ctx.CR3) << " PTEs imported\n";
+	log << BuildReverseMap(ctx) << " reverse mappings indexed\n";
+	return true;
+}
+
+void ShowHelp()
+{
+	cout << "Args: [dump-file [script|-] [-o output] [-j jobs]]\n\n"
+			"  No arguments: prompt for the dump file and start an interactive session\n"
+			"  dump-file: load this dump. Without a script, start an interactive session\n"
+			"  script: run commands from this file non-interactively, - reads stdin\n"
+			"  -o output: write command output to this file instead of stdout\n"
+			"  -j jobs: run script commands on this many threads, 0 or more than the core count = all cores\n"
+		<< endl;
+}
+
+int main(int argc, char** argv)
+{
+	string path, scriptPath, outputPath;
+	const unsigned cores = max(1u, thread::hardware_concurrency());
+	unsigned jobs = 1;
+	bool batchOptions = false;
+	DumpContext ctx;
 	
-	// Read PAE state
-	dump.seekg(0x5C); dump.read(TOSTR(&IsPae), 1);
-	cout << "PAE: " << (IsPae ? "ON " : "OFF ");
-	ctx.PAE = IsPae;
+	for(int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if(arg == "-h" || arg == "--help") return ShowHelp(), 0;
+		else if(arg == "-o" || arg == "-j") {
+			if(i + 1 >= argc) return cerr << arg << " needs a value\n", ShowHelp(), 1;
+			batchOptions = true;
+			if(arg == "-o") { outputPath = argv[++i]; continue; }
+			long value;
+			try { value = stol(argv[++i]); } catch (...) { return cerr << "Invalid job count\n", 1; }
+			if(value < 0) return cerr << "Invalid job count\n", 1;
+			// More threads than cores buys nothing, commands are CPU and page cache bound
+			jobs = value == 0 ? cores : unsigned(min<long>(value, cores));
+		}
+		else if(path.empty()) path = arg;
+		else if(scriptPath.empty()) scriptPath = arg;
+		else return ShowHelp(), 1;
+	}
+	if(batchOptions && scriptPath.empty()) return cerr << "-o and -j need a script\n", ShowHelp(), 1;
 	
-	// Get header size (pages offset)
-	dump.seekg(0x100C); dump.read(TOSTR(&ctx.PagesOffset), 4);
+	if(scriptPath.empty()) {
+		if(path.empty()) {
+			cout << "Summary dump file: >>> ";
+			getline(cin, path);
+		}
+		if(!LoadDump(ctx, path, cout)) return 1;
+		InteractiveSession(ctx);
+		return 0;
+	}
 	
-	// Get CR3
-	dump.seekg(0x10); dump.read(TOSTR(&CR3), 4);
-
-	ReadPhysicalAddress(ctx, CR3, u32b);
-	cout << hex << "CR3 = 0x" << CR3
-		 << dec << ". Importing PTEs..." << endl;
-
-	cout << PopulateTlb(ctx, CR3) << " PTEs imported\n";
+	// Batch mode, progress goes to stderr so stdout only carries command output
+	ios::sync_with_stdio(false);
+	if(!LoadDump(ctx, path, cerr)) return 1;
 	
-	InteractiveSession(ctx);
+	ifstream scriptFile;
+	if(scriptPath != "-") {
+		scriptFile.open(scriptPath);
+		if(!scriptFile) return cerr << "Cannot open script file.\n", 1;
+	}
+	istream& script = scriptPath == "-" ? cin : scriptFile;
 	
-	delete[] Bitmap;
+	vector<char> outBuffer(1 << 20);
+	ofstream outputFile;
+	if(!outputPath.empty()) {
+		outputFile.rdbuf()->pubsetbuf(outBuffer.data(), outBuffer.size());
+		outputFile.open(outputPath, ios::out | ios::trunc);
+		if(!outputFile) return cerr << "Cannot open output file.\n", 1;
+	}
+	ostream& out = outputPath.empty() ? cout : outputFile;
 	
-	return 0;
+	BatchSession(ctx, script, out, jobs);
+	out.flush();
+	return out ? 0 : 1;
 }
-